@@ -1,22 +1,21 @@
 #include "daisy_seed.h"
 #include "daisysp.h"
-#include <unordered_map>
+#include "SequencerEngine.h"
 #include <string>
 #include <vector>
 #include <random>
 #include <chrono>
+#include <algorithm>
+#include <cstdio>
 
 using namespace daisy;
 using namespace daisysp;
 using namespace std;
 
 /*
-	- Steps: Number of steps in the sequence
-	- Active_step: The current active step, is incremented for each played
-	note
-	- mode_int: An integer corresponding to the current mode, i.e:
-	Ionian, Dorian, Phrygian, Lydian, Mixolydian, Aeolian or Locrian.
-	Might not be needed in the current implementation.
+	The sequencer and the synth voice live in SequencerEngine, this file
+	only handles the hardware (buttons, pots, LEDs and audio).
+
 	- selected_note: which note in the sequence is currently selected (0-7 range)
 	- page_adder: if the second "page" is selected, which are the other 8 beats 
 	ranging from 9 - 16, the page_adder is equal to 8. This will be added in the
@@ -26,27 +25,15 @@ using namespace std;
 	- CUTOFF_MAX/CUTOFF_MIN: Range for cutoff potentiometer
 	- DECAY_MAX/DECAY_MIN: Range for the decay potentiometer.
 	- MAX_RESONANCE: The maximum value for the resonance potentiometer.
-	- FILTER_MOVEMENT: How much the filter will move with each note.
-	Thought this will correspond to amount in frequency, but not sure
-
-	- env_mod: Variable for env_mod potentiometer.
-	- cutoff: Variable for cutoff potentiometer.
-	- tempo_bpm: The current tempo of the sequencer.
-
-	- mode: This string specifies the steps for the scale going from the 
-	root note upwards. It starts from the major scale (Ionian), which for
-	C is  "C", "D", "E", "F", "G", "A", "B". 
-	This string will be left shifted to the left to change the mode.
-	- active: True/False if the sequencer is active or not. 
-	- current_note: Will change based on array "activated_notes" and determine
-	if the current step should be played or not. Only updated each tick.
 
 	- time_at_boot: Used as first seed for random generator.
+
+	- low_latency_transport: Set with "make LOW_LATENCY_TRANSPORT=1". The
+	start button then reacts on press instead of release, the tick is
+	re-phased on start and the sequencer is run before the audio block, so
+	the first step is heard in the same callback as the start press.
 */
 
-int const steps = 16;
-int active_step = 0;
-int mode_int = 0;
 int selected_note = 0;
 int page_adder = 0;
 
@@ -63,23 +50,18 @@ float const DECAY_MIN = 0.01;
 
 float const MAX_RESONANCE = 0.89; // old: 0.89
 
-int const FILTER_MOVEMENT = 11000;
-
-float env_mod = 0.8;
-float cutoff = 13000.f;
-float tempo_bpm = 120.f;
-
-string mode = "HWWHWWW"; // W = Whole step, H = Half step  
-bool active = false;
-bool current_note = true;
+#ifdef LOW_LATENCY_TRANSPORT
+bool const low_latency_transport = true;
+#else
+bool const low_latency_transport = false;
+#endif
 
 chrono::high_resolution_clock::time_point time_at_boot = chrono::high_resolution_clock::now();
 random_device rd;
 
 /*
 	- Hardware starts audio and controls daisy seed functionality.
-	- Osc is the oscillator for the bass sound of the sequncer.
-	- Envelopes for volume and for pitch of the bass.
+	- engine: The sequencer and the bass sound, see SequencerEngine.h.
 	- Switches:
 		- activate_sequence: Starting/stopping sequence
 		- random_sequnce: Randomly generated sequence based of of 
@@ -96,18 +78,16 @@ random_device rd;
 	- seq_buttons: GPIO Buttons for each note in the sequence, used to control
 	the pitch and glide for notes, aswell if they are active or not.
 	
-	- Tick for keeping time using the tick.process() function, returning
-	true when a tick is "active". The tick is set to a specific interval
-	and is activated as long as the AudioCallback (infinite loop) is active.
+	- The engine is processed every sample and is placed in DTCM.
+	DTCM is not zeroed or loaded at boot, and the DaisySP objects in the
+	engine (osc, flt, dist, the envelopes and tick) have empty
+	constructors, so they hold garbage until engine.init() sets them up.
+	engine.init() has to run before StartAudio.
 	
 */
 
 DaisySeed hardware;
-Oscillator osc;
-//infrasonic::MoogLadder flt; 
-MoogLadder flt;
-Overdrive dist;
-AdEnv synthVolEnv, synthPitchEnv;
+DTCM_MEM_SECTION SequencerEngine engine;
 //Switch activate_sequence, random_sequence, switch_mode, activate_slide, 
 Switch change_page, activate_slide;
 uint16_t activate_state = 0, random_state = 0, switch_state = 0, slide_state = 0;
@@ -116,162 +96,299 @@ AdcChannelConfig pots[NUMBER_OF_POTS];
 GPIO seq_button1, seq_button2, seq_button3, seq_button4, seq_button5, seq_button6, seq_button7, seq_button8;
 vector<GPIO> seq_buttons(8);
 
-Metro tick;
-
 //GPIO debug_led;
 GPIO page_led;
 GPIO led_decoder_out1, led_decoder_out2, led_decoder_out3;
 
-/*
-	- notes: map for storage of the notes, key - value pairs for
-	notes and their corresponding frequencies from low to high
-	- all_notes: specifiying each note avaialable, aswell as one 
-	octave of the root note. Root note is basicaly only relevant
-	when the mode button is used. It will currently be in relation 
-	to C. Changing the root 
-*/
-unordered_map<string, vector<double>> notes = {
-    {"C", {16.35, 32.70, 65.41, 130.81, 261.63, 523.25, 1046.50, 2093.00, 4186.01}},
-    {"Db", {17.32, 34.65, 69.30, 138.59, 277.18, 554.37, 1108.73, 2217.46, 4434.92}},
-    {"D", {18.35, 36.71, 73.42, 146.83, 293.66, 587.33, 1174.66, 2349.32, 4698.64}},
-    {"Eb", {19.45, 38.89, 77.78, 155.56, 311.13, 622.25, 1244.51, 2489.02, 4978.03}},
-    {"E", {20.60, 41.20, 82.41, 164.81, 329.63, 659.26, 1318.51, 2637.02}},
-    {"F", {21.83, 43.65, 87.31, 174.61, 349.23, 698.46, 1396.91, 2793.83}},
-    {"Gb", {23.12, 46.25, 92.50, 185.00, 369.99, 739.99, 1479.98, 2959.96}},
-    {"G", {24.50, 49.00, 98.00, 196.00, 392.00, 783.99, 1567.98, 3135.96}},
-    {"Ab", {25.96, 51.91, 103.83, 207.65, 415.30, 830.61, 1661.22, 3322.44}},
-    {"A", {27.50, 55.00, 110.00, 220.00, 440.00, 880.00, 1760.00, 3520.00}},
-    {"Bb", {29.14, 58.27, 116.54, 233.08, 466.16, 932.33, 1864.66, 3729.31}},
-    {"B", {30.87, 61.74, 123.47, 246.94, 493.88, 987.77, 1975.53, 3951.07}}
-};
+/**
+ * @brief 
+ * Shifts the array of all notes if the root note is to be changed.
+ * Then the modes will be taken from a "new pool" starting with a new 
+ * root note.
+ */
+	
+vector<string> circularShiftLeftArray(vector<string> array){
+    vector<string> new_array(array);
+    rotate(new_array.begin(), new_array.begin() + 1, new_array.end());
+    return new_array;
+}
 
-vector<string> all_notes = {"C","Db","D","Eb","E","F","Gb","G","Ab","A","Bb","B","C2"};
-vector<string> scale = all_notes; // Chromatic
-vector<string> sequence (steps, scale[0]);
-vector<bool> slide(steps, false);
-vector<bool> activated_notes(steps, true);
 
 /**
- * @brief
- * 	For changing the pitch of the synth. (Could be done easier)
+ * @brief 
+ * Returns a seed for SequencerEngine::randomizeSequence.
+ * The seed is based on the boot time - the current time, combined
+ * with the value of the random device "rd". Inefficient(?)
  */
 
-void setPitch(double freq){
-    synthPitchEnv.SetMax(freq);
-    synthPitchEnv.SetMin(freq);
+unsigned generateRandomSeed() {
+	auto current_time = chrono::high_resolution_clock::now();
+    unsigned seed = static_cast<unsigned>(chrono::high_resolution_clock::duration(time_at_boot - current_time).count() ^ rd());
+    //unsigned seed = static_cast<unsigned>(programStart.time_since_epoch().count()*100);
+	return seed;
 }
 
-void setSlide(double note, double note_before){
-	synthPitchEnv.SetMax(note);
-	synthPitchEnv.SetMin(note_before);
-	synthPitchEnv.SetTime(ADENV_SEG_DECAY, static_cast<float>(60/tempo_bpm));
+ITCM_TEXT bool debounce_shift(GPIO &button, uint16_t &state) {
+  //static uint16_t state = 0;
+  state = (state << 1) | button.Read() | 0xfe00;
+  return (state == 0xff00);
 }
 
+/*
+bool debounce_shift(GPIO button, uint16_t &state) {
+  //static uint16_t state = 0;
+  state = (state << 1) | button.Read() | 0xfe00;
+  return (state == 0xff00);
+}*/
+
 /**
  * @brief 
- * Shifts the mode string to the left one step. "WWHWWWH" becomes "WHWWWHW"
+ * Same history as debounce_shift, but returns true on the first high read
+ * after 8 low reads, i.e. on press instead of 8 reads after release.
+ * Bounces right after the press are ignored since they are not preceded
+ * by 8 low reads.
  */
 
-string circularShiftLeft(string mode) {
-    char first = mode[0];
-    mode.erase(0, 1);
-    return mode += first;
+ITCM_TEXT bool debounce_press(GPIO &button, uint16_t &state) {
+  state = (state << 1) | button.Read() | 0xfe00;
+  return ((state & 0x1ff) == 0x001);
+}
+
+/*
+	Latency measurement, enabled with "make LATENCY_MEASUREMENT=1".
+
+	- sample_clock: Number of samples (per channel) since the audio started,
+	used as timestamp for everything below.
+	- LatencyProbe: Timestamps of the last press of a button (the first
+	high read after 8 low reads) and of the release after it (the last
+	high to low read before the input is accepted, so bounces during the
+	press are skipped), and if it is still waiting to be handled. An
+	input is timed from the edge its debounce acts on: the release for
+	debounce_shift, the press for debounce_press.
+	- LatencyStats: Histogram with LATENCY_BIN_MS wide bins, the last bin
+	holds everything above. Min/max are kept in samples.
+	
+	Measured:
+		- seq_button_latency: seq_buttons release -> debounce_shift accepts it
+		- seq_step_latency: seq_buttons release -> first sample of the
+		edited step the next time it is played
+		- transport_input_latency: activate_sequence edge -> accepted
+		- transport_sound_latency: activate_sequence edge -> first sample
+		of the first note after start
+	Codec and DMA latency is not included. Results are printed over USB
+	serial every LATENCY_REPORT_MS.
+*/
+
+#ifdef LATENCY_MEASUREMENT
+
+int const LATENCY_BINS = 128;
+int const LATENCY_BIN_MS = 2;
+int const LATENCY_REPORT_MS = 5000;
+
+struct LatencyProbe {
+	uint32_t press = 0, release = 0, edge = 0;
+	bool pending = false, released = false;
+};
+
+struct LatencyStats {
+	const char* name;
+	uint32_t histogram[LATENCY_BINS];
+	uint32_t count;
+	uint32_t min, max;
+};
+
+uint32_t sample_clock = 0;
+float samples_per_ms = 48.f;
+bool note_triggered = false;
+int triggered_step = 0;
+
+LatencyProbe transport_probe, transport_start_probe;
+LatencyProbe seq_button_probes[8];
+LatencyProbe seq_step_probes[SequencerEngine::STEPS];
+LatencyStats seq_button_latency = {"seq button -> accepted"};
+LatencyStats seq_step_latency = {"seq button -> step heard"};
+LatencyStats transport_input_latency = {"transport -> accepted"};
+LatencyStats transport_sound_latency = {"transport -> first note"};
+
+ITCM_TEXT void latencyAdd(LatencyStats &stats, uint32_t samples){
+	int bin = static_cast<int>(samples / samples_per_ms) / LATENCY_BIN_MS;
+	stats.histogram[bin < LATENCY_BINS ? bin : LATENCY_BINS - 1]++;
+	if(stats.count == 0 || samples < stats.min)
+		stats.min = samples;
+	if(samples > stats.max)
+		stats.max = samples;
+	stats.count++;
 }
 
 /**
  * @brief 
- * Shifts the array of all notes if the root note is to be changed.
- * Then the modes will be taken from a "new pool" starting with a new 
- * root note.
+ * Adds the time from the probe's edge to the given sample if the probe
+ * is pending. Returns true if it was.
  */
-	
-vector<string> circularShiftLeftArray(vector<string> array){
-    vector<string> new_array(array);
-    rotate(new_array.begin(), new_array.begin() + 1, new_array.end());
-    return new_array;
+
+ITCM_TEXT bool latencyResolve(LatencyProbe &probe, LatencyStats &stats, uint32_t sample){
+	if(!probe.pending)
+		return false;
+	latencyAdd(stats, sample - probe.edge);
+	probe.pending = false;
+	return true;
 }
 
+/**
+ * @brief 
+ * Call after each debounce with the button's history, before
+ * latencyInputAccepted. Stores the time of the press and of every high
+ * to low read after it, the last one before acceptance is the release.
+ */
+
+ITCM_TEXT void latencyInputEdge(LatencyProbe &probe, uint16_t state){
+	if((state & 0x1ff) == 0x001){
+		probe.press = sample_clock;
+		probe.pending = true;
+		probe.released = false;
+	}
+	else if(probe.pending && (state & 0x3) == 0x2){
+		probe.release = sample_clock;
+		probe.released = true;
+	}
+}
 
 /**
  * @brief 
- * 	Generates a new scale based on the current one. This function will
- * 	insert notes into the global "scale" variable based on the steps in
- * the "mode" string. If there is a "W" (whole-step) it will "jump" two
- * steps, "semi-tones", in the all_notes array, otherwise just one step.
+ * Call when the debounce accepts the input. Times it from the release if
+ * there was one, otherwise from the press, and keeps that edge in
+ * probe.edge. Returns true if a press was pending.
  */
 
+ITCM_TEXT bool latencyInputAccepted(LatencyProbe &probe, LatencyStats &stats){
+	probe.edge = probe.released ? probe.release : probe.press;
+	return latencyResolve(probe, stats, sample_clock);
+}
 
-vector<string> generateScale(){
-    vector<string> new_scale(8);
+/**
+ * @brief 
+ * Called when the sequencer is started or stopped. On start the press
+ * is kept until the first note is triggered. On stop pending step edits
+ * are dropped, the time spent stopped is not latency.
+ */
 
-    int index = 0;
-    size_t notes_collected = 0;
-    while (notes_collected < 8)
-    {
-        new_scale[notes_collected] = all_notes[index % all_notes.size()];
-        index += (mode[notes_collected] == 'W') ? 2 : 1;
-        notes_collected++;
-    }  
-    return new_scale;      
+ITCM_TEXT void latencyTransportToggled(bool started){
+	bool measured = latencyInputAccepted(transport_probe, transport_input_latency);
+	transport_start_probe.edge = transport_probe.edge;
+	transport_start_probe.pending = started && measured;
+	if(!started)
+		for(LatencyProbe &probe : seq_step_probes)
+			probe.pending = false;
 }
 
 /**
  * @brief 
- * Returns a new sequence with the same size as the old one which has
- * randomly generated notes taken from the "scale pool" of notes.
- * The seed is based on the boot time - the current time, combined
- * with the value of the random device "rd". Inefficient(?)
+ * Called when a seq button edits a step. While the sequencer is running
+ * the edge is kept until that step is triggered again.
  */
 
-mt19937 generateRandomEngine() {
-	auto current_time = chrono::high_resolution_clock::now();
-    unsigned seed = static_cast<unsigned>(chrono::high_resolution_clock::duration(time_at_boot - current_time).count() ^ rd());
-    //unsigned seed = static_cast<unsigned>(programStart.time_since_epoch().count()*100);
-	return mt19937(seed);
+ITCM_TEXT void latencySeqButtonAccepted(int button, int step, bool running){
+	LatencyProbe &probe = seq_button_probes[button];
+	bool measured = latencyInputAccepted(probe, seq_button_latency);
+	seq_step_probes[step].edge = probe.edge;
+	seq_step_probes[step].pending = measured && running;
 }
 
-vector<string> randomizeSequence(){
-	mt19937 rng = generateRandomEngine();
-    vector<string> resulting_sequence(sequence.size());
+ITCM_TEXT void latencyNoteTriggered(int step){
+	note_triggered = true;
+	triggered_step = step;
+}
 
-    for(int i = 0; i < static_cast<int>(resulting_sequence.size()); i++){    
-        uniform_int_distribution<unsigned> distrib(0, scale.size() - 1);
-		int randomIndex = distrib(rng);
-		resulting_sequence[i] = scale[randomIndex];
-    }
+/**
+ * @brief 
+ * Called at the end of each AudioCallback. A note triggered in this
+ * callback is heard from the start of this block with
+ * low_latency_transport, otherwise from the start of the next one.
+ */
 
-    return resulting_sequence;
+ITCM_TEXT void latencyBlockDone(size_t size){
+	size_t offset = low_latency_transport ? 0 : size / 2;
+	if(note_triggered){
+		latencyResolve(transport_start_probe, transport_sound_latency, sample_clock + offset);
+		latencyResolve(seq_step_probes[triggered_step], seq_step_latency, sample_clock + offset);
+	}
+	note_triggered = false;
+	sample_clock += size / 2;
 }
 
-float convertBPMtoFreq(float bpm){
-	return (bpm / 60.f)*8.f;
+/**
+ * @brief 
+ * Writes the range of a histogram bin, e.g. "<4ms" for the upper edge,
+ * or ">=254ms" for the last bin since it has no upper edge.
+ */
+
+void latencyBinText(char* text, size_t size, int bin){
+	if(bin == LATENCY_BINS - 1)
+		snprintf(text, size, ">=%dms", bin * LATENCY_BIN_MS);
+	else
+		snprintf(text, size, "<%dms", (bin + 1) * LATENCY_BIN_MS);
 }
 
-void increasePitchForActiveNote(){
-	for(int i = 0; i < 8; i++){
-		if(sequence[selected_note] == scale[i] && i == 7){
-			sequence[selected_note] = scale[1];
-			break;
-		}
-		else if (sequence[selected_note] == scale[i]){
-			sequence[selected_note] = scale[i+1];
+/**
+ * @brief 
+ * Writes the range of the bin that holds the given percentile.
+ */
+
+void latencyPercentile(char* text, size_t size, const LatencyStats &stats, int percent){
+	uint32_t target = (stats.count * percent + 99) / 100;
+	uint32_t seen = 0;
+	int bin = 0;
+	for(; bin < LATENCY_BINS - 1; bin++){
+		seen += stats.histogram[bin];
+		if(seen >= target)
 			break;
-		}
 	}
+	latencyBinText(text, size, bin);
 }
 
-bool debounce_shift(GPIO &button, uint16_t &state) {
-  //static uint16_t state = 0;
-  state = (state << 1) | button.Read() | 0xfe00;
-  return (state == 0xff00);
+int latencyToUs(uint32_t samples){
+	return static_cast<int>(samples * 1000.f / samples_per_ms);
 }
 
-/*
-bool debounce_shift(GPIO button, uint16_t &state) {
-  //static uint16_t state = 0;
-  state = (state << 1) | button.Read() | 0xfe00;
-  return (state == 0xff00);
-}*/
+/**
+ * @brief 
+ * Prints count, min/max (us), p50/p90/p99 (ms, bin resolution) and the
+ * non-empty histogram bins. Values are written from the AudioCallback,
+ * a report can be off by one press.
+ */
+
+void printLatency(const LatencyStats &stats){
+	if(stats.count == 0){
+		hardware.PrintLine("%s: no presses", stats.name);
+		return;
+	}
+
+	char p50[12], p90[12], p99[12];
+	latencyPercentile(p50, sizeof(p50), stats, 50);
+	latencyPercentile(p90, sizeof(p90), stats, 90);
+	latencyPercentile(p99, sizeof(p99), stats, 99);
+	hardware.PrintLine("%s: n=%lu min=%dus p50%s p90%s p99%s max=%dus",
+		stats.name, stats.count, latencyToUs(stats.min),
+		p50, p90, p99, latencyToUs(stats.max));
+
+	for(int i = 0; i < LATENCY_BINS - 1; i++)
+		if(stats.histogram[i])
+			hardware.PrintLine("  %4d-%4dms: %lu", i * LATENCY_BIN_MS,
+				(i + 1) * LATENCY_BIN_MS, stats.histogram[i]);
+	if(stats.histogram[LATENCY_BINS - 1])
+		hardware.PrintLine("  >=%4dms: %lu", (LATENCY_BINS - 1) * LATENCY_BIN_MS,
+			stats.histogram[LATENCY_BINS - 1]);
+}
+
+void reportLatency(){
+	hardware.PrintLine("Latency (%s transport):", low_latency_transport ? "low latency" : "normal");
+	printLatency(seq_button_latency);
+	printLatency(seq_step_latency);
+	printLatency(transport_input_latency);
+	printLatency(transport_sound_latency);
+}
+
+#endif
 
 
 /*
@@ -353,21 +470,25 @@ bool debounceButton(GPIO button, chrono::milliseconds &lastDebounceTime) {
  * Press slide button before pressing the note in the sequence.
  */
 
-void handleSequenceButtons(){
+ITCM_TEXT void handleSequenceButtons(){
 	for(int i = 0; i < 8; i++){ // 8 = number of buttons
 		//if(debounce(seq_buttons[i], last_button_states[i], counters[i])){
 		//if(debounce(seq_buttons[i], last_button_states[i], counters[i])) {
-		if(debounce_shift(seq_buttons[i], last_button_states[i])) {
+		bool pressed = debounce_shift(seq_buttons[i], last_button_states[i]);
+#ifdef LATENCY_MEASUREMENT
+		latencyInputEdge(seq_button_probes[i], last_button_states[i]);
+		if(pressed)
+			latencySeqButtonAccepted(i, i + page_adder, engine.isActive());
+#endif
+		if(pressed) {
 			if(!activate_slide.Pressed())
-				slide[i + page_adder] = !slide[i + page_adder];
+				engine.toggleSlide(i + page_adder);
 			else{
-				int pitch = hardware.adc.GetFloat(3) * scale.size(); // 0 - 7
+				int pitch = hardware.adc.GetFloat(3) * engine.scaleSize(); // 0 - 7
 				if(pitch == 0)
-					activated_notes[i + page_adder] = !activated_notes[i + page_adder];
-				else{
-					sequence[i + page_adder] = scale[pitch];
-					activated_notes[i + page_adder] = true;
-				}
+					engine.toggleStep(i + page_adder);
+				else
+					engine.setStepNote(i + page_adder, pitch);
 			}
 		}
 	}
@@ -376,41 +497,37 @@ void handleSequenceButtons(){
 //bool last_page_button_state = false;
 //int page_button_counter = 0;
 
-void inputHandler(){
+ITCM_TEXT void inputHandler(){
 	// Filters out noise from button-press.	
 	
 	activate_slide.Debounce();
 	change_page.Debounce();
 	
-	if(debounce_shift(activate_sequence, activate_state))
-        active = !active;
+	bool start_stop = low_latency_transport ? debounce_press(activate_sequence, activate_state)
+		: debounce_shift(activate_sequence, activate_state);
+#ifdef LATENCY_MEASUREMENT
+	latencyInputEdge(transport_probe, activate_state);
+#endif
+	if(start_stop){
+		if(engine.isActive())
+			engine.stop();
+		else
+			engine.start();
+#ifdef LATENCY_MEASUREMENT
+		latencyTransportToggled(engine.isActive());
+#endif
+	}
 
 	if(change_page.RisingEdge()){
 		page_adder = (page_adder + 8) % 16; // cycles between 8 or 0
 		page_led.Write(page_adder);
 	}
 
-	if(debounce_shift(random_sequence, random_state)){
-        active_step = 0;
-        sequence = randomizeSequence();
-    }
+	if(debounce_shift(random_sequence, random_state))
+        engine.randomizeSequence(generateRandomSeed());
 	
-	if(debounce_shift(switch_mode, switch_state)){
-        if(mode_int == 7) mode_int = 0;
-        else mode_int++;
-
-		if(mode_int != 0){ // not chromatic
-        	mode = circularShiftLeft(mode);
-			scale = generateScale();
-		}
-		else scale = all_notes;
-
-        // Temporarily fill sequence with notes from scale.
-		for(size_t i = 0; i < steps; i++)
-			sequence[i] = scale[i % scale.size()];
-
-		
-    }
+	if(debounce_shift(switch_mode, switch_state))
+        engine.nextMode();
 	//if(debounce(change_page, last_page_button_state, page_button_counter))
 	//	page_adder = (page_adder + 8) % 16; // cycles between 8 or 0
 
@@ -420,108 +537,34 @@ void inputHandler(){
 
 	handleSequenceButtons();
 
-	tempo_bpm = floor((hardware.adc.GetFloat(0) * (HIGH_RANGE_BPM - LOW_RANGE_BPM)) + LOW_RANGE_BPM); // BPM range from 30-300
-	tick.SetFreq(convertBPMtoFreq(tempo_bpm));
+	engine.setTempo(floor((hardware.adc.GetFloat(0) * (HIGH_RANGE_BPM - LOW_RANGE_BPM)) + LOW_RANGE_BPM)); // BPM range from 30-300
 	
-	cutoff = hardware.adc.GetFloat(1) * (CUTOFF_MAX - CUTOFF_MIN) + CUTOFF_MIN;
+	engine.setCutoff(hardware.adc.GetFloat(1) * (CUTOFF_MAX - CUTOFF_MIN) + CUTOFF_MIN);
 
 	float resonance = hardware.adc.GetFloat(2) * (MAX_RESONANCE); // 0 - 0.89
-	flt.SetRes(resonance);
+	engine.setResonance(resonance);
 
 	float decay = hardware.adc.GetFloat(4) * (DECAY_MAX - DECAY_MIN) + DECAY_MIN;
-	synthVolEnv.SetTime(ADENV_SEG_DECAY, decay);
+	engine.setDecay(decay);
 	
-	env_mod = hardware.adc.GetFloat(5) * 1.0;
-	dist.SetDrive(hardware.adc.GetFloat(6) * 0.7);
+	engine.setEnvMod(hardware.adc.GetFloat(5) * 1.0);
+	engine.setDrive(hardware.adc.GetFloat(6) * 0.7);
 }	
 
 /**
  * @brief 
- * Prepares the sample for the output audio. 
- * Signal processing is difficult...
+ * Shows the step on the LEDs through the decoder, if it is on the
+ * current page.
  */
-	
-
-void prepareAudioBlock(size_t size, AudioHandle::InterleavingOutputBuffer out){
-	float osc_out, synth_env_out, sig;
-	for(size_t i = 0; i < size; i += 2) {
-		//Get the next volume samples
-		synth_env_out = synthVolEnv.Process();
-		//Apply the pitch envelope to the synth
-		osc.SetFreq(synthPitchEnv.Process());
-		//Set the synth volume to the envelope's output
-		osc.SetAmp(synth_env_out);
-		//Process the next oscillator sample
-		osc_out = osc.Process();
-		
-		// Blend cutoff with movement based on envelope
-		flt.SetFreq(env_mod * synth_env_out * FILTER_MOVEMENT + cutoff);
-		
-		sig = dist.Process(flt.Process(osc_out));
-
-		out[i]     = sig;
-		out[i + 1] = sig;
-	}
-}
 
-double getFreqOfNote(string note){
-	double current_freq;
-	if(note == "C2")
-		current_freq = notes[note.substr(0,1)][3];
-	else
-		current_freq = notes[note][2];
+ITCM_TEXT void showStep(int step){
+	// int adder = page_adder & 8 ? 0x007 : 0x000;
+	// int mask = page_adder ? 15 : 7;
 
-	return current_freq;
-}
-
-/**
- * @brief 
- * Handles negative numbers, true modulo
- * @param dividend 
- * @param divisor 
- * @return int 
- */
-
-int modulo(int dividend, int divisor){
-	return (dividend % divisor + divisor) % divisor;
-}
-	
-/**
- * @brief 
- * Triggers a note in the sequence, and increases the active step.
- * If the active step is at the last place, and the synth is at the first 
- * mode it wants to access the C note one octave above (one place forward
- * in the map with frequencies for each note).
- */
-	
-
-void triggerSequence(){
-	if(tick.Process()){
-		// Access the current note in the scale
-		// int adder = page_adder & 8 ? 0x007 : 0x000;
-		// int mask = page_adder ? 15 : 7;
-
-		bool current_page = !((active_step >> 3) ^ (page_adder >> 3));
-		led_decoder_out1.Write(current_page * (active_step & 0x1));
-		led_decoder_out2.Write(current_page * (active_step & 0x2));
-		led_decoder_out3.Write(current_page * (active_step & 0x4));
-
-		string note = sequence[active_step];
-		double current_freq = getFreqOfNote(note);
-		
-		if(slide[active_step]){
-			double previous_freq = getFreqOfNote(sequence[modulo((active_step - 1), steps)]); 
-			setSlide(current_freq, previous_freq);
-		}
-		else
-			setPitch(current_freq);
-		synthVolEnv.Trigger();
-		synthPitchEnv.Trigger();
-		
-		// Increase the step in sequence, and set the next current note
-		active_step = (active_step + 1) % steps;
-		current_note = activated_notes[active_step];
-	}
+	bool current_page = !((step >> 3) ^ (page_adder >> 3));
+	led_decoder_out1.Write(current_page * (step & 0x1));
+	led_decoder_out2.Write(current_page * (step & 0x2));
+	led_decoder_out3.Write(current_page * (step & 0x4));
 }
 
 /**
@@ -535,49 +578,10 @@ void triggerSequence(){
 void configureAndInitHardware(){
 	hardware.Configure();
 	hardware.Init();
-	hardware.SetAudioBlockSize(4); 
+	hardware.SetAudioBlockSize(SequencerEngine::BLOCK_SIZE); 
 	//hardware.SetAudioSampleRate(SaiHandle::Config::SampleRate::SAI_48KHZ);
 }
 
-/**
- * @brief 
- * Initialize oscillator for synthesizer, and set initial amplitude
- * to 1.
- */
-
-void initOscillator(float samplerate){
-    osc.Init(samplerate);
-    osc.SetWaveform(Oscillator::WAVE_SAW);
-    osc.SetAmp(1);
-}
-
-/**
- * @brief 
- * This envelope will control the kick oscillator's pitch
- * Note that this envelope is much faster than the volume
- */
-
-void initPitchEnv(float samplerate){	
-    synthPitchEnv.Init(samplerate);
-    synthPitchEnv.SetTime(ADENV_SEG_ATTACK, .01);
-    synthPitchEnv.SetTime(ADENV_SEG_DECAY, .05);
-    synthPitchEnv.SetMax(400);
-    synthPitchEnv.SetMin(400);
-}
-
-/** 
- * @brief 
- * This one will control the kick's volume
- */
-
-void initVolEnv(float samplerate){
-	synthVolEnv.Init(samplerate);
-    synthVolEnv.SetTime(ADENV_SEG_ATTACK, .01);
-    synthVolEnv.SetTime(ADENV_SEG_DECAY, 1);
-    synthVolEnv.SetMax(1);
-    synthVolEnv.SetMin(0);
-}
-
  /**
   * @brief 
   * Initialize the buttons on pins 28, 27 and 25. (35, 34, 32 on the
@@ -611,24 +615,6 @@ void initPots(){
 	hardware.adc.Init(pots, NUMBER_OF_POTS); // Set ADC to use our configuration, and how many pots
 }
 
-void initFilter(float samplerate){
-	flt.Init(samplerate);
-	flt.SetRes(0.7);
-	flt.SetFreq(700);
-}
-
-/**
- * @brief 
- * Initialize Metro object at bpm (ex 120) divided by 60 resulting 
- * in the freq for a note for each 4th beat. Multiply by 4 to get 
- * for each beat.
-*/	
-
-void initTick(float samplerate){
-    tick.Init((tempo_bpm / 60.f)*4.f, samplerate);
-}
-
-
 void initSeqButtons(){
 	seq_button1.Init(daisy::seed::D1, GPIO::Mode::INPUT, GPIO::Pull::NOPULL);
 	seq_button2.Init(daisy::seed::D2, GPIO::Mode::INPUT, GPIO::Pull::NOPULL);
@@ -642,44 +628,62 @@ void initSeqButtons(){
 	seq_buttons = {seq_button1, seq_button2, seq_button3, seq_button4, seq_button5, seq_button6, seq_button7, seq_button8};
 }
 
-void playSequence(size_t size, AudioHandle::InterleavingOutputBuffer out){
-	if(active) {
-		prepareAudioBlock(size, out);
-		// Change decoder write here if want to see led light up on inactive steps aswell
-		if(current_note)
-			triggerSequence();
+/**
+ * @brief 
+ * Reads the inputs and renders the next block with the engine. The step
+ * is shown on the LEDs when a note is triggered, change decoder write
+ * here if want to see led light up on inactive steps aswell.
+ */
 
-		else if (tick.Process()) {
-			active_step = (active_step + 1) % steps;
-			current_note = activated_notes[active_step];
-		}
+ITCM_TEXT void AudioCallback(AudioHandle::InterleavingInputBuffer in, AudioHandle::InterleavingOutputBuffer out, size_t size) {
+	inputHandler();
+	if(engine.processBlock(out, size)){
+		showStep(engine.lastTriggeredStep());
+#ifdef LATENCY_MEASUREMENT
+		latencyNoteTriggered(engine.lastTriggeredStep());
+#endif
 	}
-	else
-		for(size_t i = 0; i < size; i += 2) {
-			out[i] = out[i] * 0.9; // Audio ramp-down
-			out[i + 1] = out[i] * 0.9;
-		}
+#ifdef LATENCY_MEASUREMENT
+	latencyBlockDone(size);
+#endif
 }
 
-void AudioCallback(AudioHandle::InterleavingInputBuffer in, AudioHandle::InterleavingOutputBuffer out, size_t size) {
-	inputHandler();
-	playSequence(size, out);
+/**
+ * @brief 
+ * Copies the .itcm_text section from flash to ITCM. The symbols are
+ * defined in 303Sequencer_itcm.ld. It is run from .preinit_array, which
+ * __libc_init_array calls before any static constructor, so ITCM_TEXT
+ * code is loaded before anything can call it. loadItcm itself stays in
+ * flash. ITCM starts at address 0, so the copy is a volatile word loop
+ * instead of memcpy (the section is word aligned in the linker script).
+ */
+
+extern uint32_t _sitcm_text, _eitcm_text, _siitcm_text;
+
+static void loadItcm(){
+	volatile uint32_t* destination = &_sitcm_text;
+	volatile uint32_t* source = &_siitcm_text;
+	while(destination < &_eitcm_text)
+		*destination++ = *source++;
 }
 
+__attribute__((section(".preinit_array"), used))
+static void (*const load_itcm_at_boot)() = loadItcm;
+
 int main(void) {
 	configureAndInitHardware();
 	
 	float samplerate = hardware.AudioSampleRate();
+#ifdef LATENCY_MEASUREMENT
+	samples_per_ms = samplerate / 1000.f;
+	hardware.StartLog();
+#endif
 	
-	initOscillator(samplerate);
-	initPitchEnv(samplerate);
-	initVolEnv(samplerate);
+	engine.init(samplerate);
+	engine.setLowLatencyTransport(low_latency_transport);
 	initButtons(samplerate);
 	initPots();
-	initFilter(samplerate);
-	initTick(samplerate);
 	initSeqButtons();
-	dist.SetDrive(0.5);
 	
 	//change_page.Init(daisy::seed::D5, GPIO::Mode::INPUT);
 	led_decoder_out1.Init(daisy::seed::D12, GPIO::Mode::OUTPUT);
@@ -700,5 +704,10 @@ int main(void) {
 	hardware.adc.Start(); // Start ADC
     hardware.StartAudio(AudioCallback);
     // Loop forever
-    for(;;) {}
+    for(;;) {
+#ifdef LATENCY_MEASUREMENT
+		System::Delay(LATENCY_REPORT_MS);
+		reportLatency();
+#endif
+	}
 }
\ No newline at end of file
@@ -0,0 +1,387 @@
+#include "SequencerEngine.h"
+#include <random>
+#include <cstring>
+
+using namespace daisysp;
+using namespace std;
+
+/*
+	- note_freqs: table of the frequencies of each note from low to high,
+	one row per note (C to B). Kept const so it stays in flash instead of
+	being built on the heap at boot.
+	E to B have one octave less, the last column is 0 for those.
+	- all_notes: names of each note avaialable, aswell as one
+	octave of the root note. The engine stores notes as indices into it. Root note is basicaly only relevant
+	when the mode button is used. It will currently be in relation
+	to C. Changing the root
+	Plain const char arrays are constant initialized, so they are ready
+	before any constructor runs (the engine on the Daisy is a global).
+*/
+
+static int const NUMBER_OF_NOTES = 12;
+static int const NUMBER_OF_OCTAVES = 9;
+
+static const double note_freqs[NUMBER_OF_NOTES][NUMBER_OF_OCTAVES] = {
+    {16.35, 32.70, 65.41, 130.81, 261.63, 523.25, 1046.50, 2093.00, 4186.01}, // C
+    {17.32, 34.65, 69.30, 138.59, 277.18, 554.37, 1108.73, 2217.46, 4434.92}, // Db
+    {18.35, 36.71, 73.42, 146.83, 293.66, 587.33, 1174.66, 2349.32, 4698.64}, // D
+    {19.45, 38.89, 77.78, 155.56, 311.13, 622.25, 1244.51, 2489.02, 4978.03}, // Eb
+    {20.60, 41.20, 82.41, 164.81, 329.63, 659.26, 1318.51, 2637.02, 0},       // E
+    {21.83, 43.65, 87.31, 174.61, 349.23, 698.46, 1396.91, 2793.83, 0},       // F
+    {23.12, 46.25, 92.50, 185.00, 369.99, 739.99, 1479.98, 2959.96, 0},       // Gb
+    {24.50, 49.00, 98.00, 196.00, 392.00, 783.99, 1567.98, 3135.96, 0},       // G
+    {25.96, 51.91, 103.83, 207.65, 415.30, 830.61, 1661.22, 3322.44, 0},      // Ab
+    {27.50, 55.00, 110.00, 220.00, 440.00, 880.00, 1760.00, 3520.00, 0},      // A
+    {29.14, 58.27, 116.54, 233.08, 466.16, 932.33, 1864.66, 3729.31, 0},      // Bb
+    {30.87, 61.74, 123.47, 246.94, 493.88, 987.77, 1975.53, 3951.07, 0}       // B
+};
+
+static const char* const all_notes[SequencerEngine::MAX_SCALE_NOTES] = {
+	"C", "Db", "D", "Eb", "E", "F", "Gb", "G", "Ab", "A", "Bb", "B", "C2"
+};
+
+/**
+ * @brief
+ * Looks up the frequency of a note (index into all_notes) in the
+ * note_freqs table. "C2" is the C one octave above the rest of the notes.
+ */
+
+ITCM_TEXT static double getFreqOfNote(uint8_t note){
+	int octave = (note == NUMBER_OF_NOTES) ? 3 : 2;
+	return note_freqs[note % NUMBER_OF_NOTES][octave];
+}
+
+/**
+ * @brief
+ * Shifts the mode string to the left one step. "WWHWWWH" becomes "WHWWWHW"
+ */
+
+static void circularShiftLeft(char* mode) {
+    size_t length = strlen(mode);
+    char first = mode[0];
+    memmove(mode, mode + 1, length - 1);
+    mode[length - 1] = first;
+}
+
+/**
+ * @brief
+ * Handles negative numbers, true modulo
+ * @param dividend
+ * @param divisor
+ * @return int
+ */
+
+ITCM_TEXT static int modulo(int dividend, int divisor){
+	return (dividend % divisor + divisor) % divisor;
+}
+
+ITCM_TEXT static float convertBPMtoFreq(float bpm){
+	return (bpm / 60.f)*8.f;
+}
+
+SequencerEngine::SequencerEngine(){
+	setChromaticScale();
+	for(int i = 0; i < STEPS; i++){
+		sequence[i] = 0; // C
+		slide[i] = false;
+		activated_notes[i] = true;
+	}
+}
+
+const char* SequencerEngine::noteName(int note){
+	return all_notes[note];
+}
+
+/**
+ * @brief
+ * Initialize the synth voice and the tick.
+ * - Oscillator at amplitude 1.
+ * - Pitch envelope, note that this envelope is much faster than the volume.
+ * - Tick at bpm (ex 120) divided by 60 resulting in the freq for a note
+ * for each 4th beat. Multiply by 4 to get for each beat.
+ */
+
+void SequencerEngine::init(float samplerate){
+    osc.Init(samplerate);
+    osc.SetWaveform(Oscillator::WAVE_SAW);
+    osc.SetAmp(1);
+
+    synthPitchEnv.Init(samplerate);
+    synthPitchEnv.SetTime(ADENV_SEG_ATTACK, .01);
+    synthPitchEnv.SetTime(ADENV_SEG_DECAY, .05);
+    synthPitchEnv.SetMax(400);
+    synthPitchEnv.SetMin(400);
+
+	synthVolEnv.Init(samplerate);
+    synthVolEnv.SetTime(ADENV_SEG_ATTACK, .01);
+    synthVolEnv.SetTime(ADENV_SEG_DECAY, 1);
+    synthVolEnv.SetMax(1);
+    synthVolEnv.SetMin(0);
+
+	flt.Init(samplerate);
+	flt.SetRes(0.7);
+	flt.SetFreq(700);
+
+    tick.Init((tempo_bpm / 60.f)*4.f, samplerate);
+	dist.SetDrive(0.5);
+}
+
+void SequencerEngine::start(){
+	active = true;
+	transport_started = true;
+}
+
+void SequencerEngine::stop(){
+	active = false;
+	transport_started = false;
+}
+
+ITCM_TEXT void SequencerEngine::setTempo(float bpm){
+	tempo_bpm = bpm;
+	tick.SetFreq(convertBPMtoFreq(tempo_bpm));
+}
+
+ITCM_TEXT void SequencerEngine::setResonance(float resonance){
+	flt.SetRes(resonance);
+}
+
+ITCM_TEXT void SequencerEngine::setDecay(float decay){
+	synthVolEnv.SetTime(ADENV_SEG_DECAY, decay);
+}
+
+ITCM_TEXT void SequencerEngine::setDrive(float drive){
+	dist.SetDrive(drive);
+}
+
+/**
+ * @brief
+ * 	For changing the pitch of the synth. (Could be done easier)
+ */
+
+ITCM_TEXT void SequencerEngine::setPitch(double freq){
+    synthPitchEnv.SetMax(freq);
+    synthPitchEnv.SetMin(freq);
+}
+
+ITCM_TEXT void SequencerEngine::setSlide(double note, double note_before){
+	synthPitchEnv.SetMax(note);
+	synthPitchEnv.SetMin(note_before);
+	synthPitchEnv.SetTime(ADENV_SEG_DECAY, static_cast<float>(60/tempo_bpm));
+}
+
+/**
+ * @brief
+ * 	Fills the scale with every note from C to C one octave up.
+ */
+
+void SequencerEngine::setChromaticScale(){
+	for(int i = 0; i < MAX_SCALE_NOTES; i++)
+		scale[i] = i;
+	scale_size = MAX_SCALE_NOTES;
+}
+
+/**
+ * @brief
+ * 	Generates a new scale based on the current one. This function will
+ * 	insert notes into the "scale" variable based on the steps in
+ * the "mode" string. If there is a "W" (whole-step) it will "jump" two
+ * steps, "semi-tones", in the all_notes array, otherwise just one step.
+ */
+
+void SequencerEngine::generateScale(){
+    int index = 0;
+    int notes_collected = 0;
+    while (notes_collected < 8)
+    {
+        scale[notes_collected] = index % MAX_SCALE_NOTES;
+        index += (mode[notes_collected] == 'W') ? 2 : 1;
+        notes_collected++;
+    }
+    scale_size = 8;
+}
+
+/**
+ * @brief
+ * Goes to the next mode (chromatic after Locrian) and temporarily fills
+ * the sequence with notes from the new scale.
+ */
+
+void SequencerEngine::nextMode(){
+	if(mode_int == 7) mode_int = 0;
+	else mode_int++;
+
+	if(mode_int != 0){ // not chromatic
+		circularShiftLeft(mode);
+		generateScale();
+	}
+	else setChromaticScale();
+
+	for(int i = 0; i < STEPS; i++)
+		sequence[i] = scale[i % scale_size];
+}
+
+/**
+ * @brief
+ * Steps through the modes from the current one until new_mode is
+ * reached, the same as pressing the mode button that many times.
+ */
+
+void SequencerEngine::setMode(int new_mode){
+	while(mode_int != modulo(new_mode, 8))
+		nextMode();
+}
+
+/**
+ * @brief
+ * Replaces the sequence with randomly generated notes taken from the
+ * "scale pool" of notes, and starts over from the first step.
+ * The same seed always gives the same sequence for a given scale.
+ */
+
+void SequencerEngine::randomizeSequence(unsigned seed){
+	mt19937 rng(seed);
+	active_step = 0;
+
+    for(int i = 0; i < STEPS; i++){
+        uniform_int_distribution<unsigned> distrib(0, scale_size - 1);
+		int randomIndex = distrib(rng);
+		sequence[i] = scale[randomIndex];
+    }
+}
+
+void SequencerEngine::toggleSlide(int step){
+	slide[step] = !slide[step];
+}
+
+void SequencerEngine::toggleStep(int step){
+	activated_notes[step] = !activated_notes[step];
+}
+
+void SequencerEngine::setStepNote(int step, int scale_index){
+	sequence[step] = scale[scale_index];
+	activated_notes[step] = true;
+}
+
+void SequencerEngine::increasePitchForNote(int step){
+	for(int i = 0; i < 8; i++){
+		if(sequence[step] == scale[i] && i == 7){
+			sequence[step] = scale[1];
+			break;
+		}
+		else if (sequence[step] == scale[i]){
+			sequence[step] = scale[i+1];
+			break;
+		}
+	}
+}
+
+/**
+ * @brief
+ * Prepares the sample for the output audio.
+ * Signal processing is difficult...
+ */
+
+ITCM_TEXT void SequencerEngine::prepareAudioBlock(size_t size, float* out){
+	float osc_out, synth_env_out, sig;
+	for(size_t i = 0; i < size; i += 2) {
+		//Get the next volume samples
+		synth_env_out = synthVolEnv.Process();
+		//Apply the pitch envelope to the synth
+		osc.SetFreq(synthPitchEnv.Process());
+		//Set the synth volume to the envelope's output
+		osc.SetAmp(synth_env_out);
+		//Process the next oscillator sample
+		osc_out = osc.Process();
+
+		// Blend cutoff with movement based on envelope
+		flt.SetFreq(env_mod * synth_env_out * FILTER_MOVEMENT + cutoff);
+
+		sig = dist.Process(flt.Process(osc_out));
+
+		out[i]     = sig;
+		out[i + 1] = sig;
+	}
+}
+
+/**
+ * @brief
+ * Triggers a note in the sequence, and increases the active step.
+ * If the active step is at the last place, and the synth is at the first
+ * mode it wants to access the C note one octave above (one place forward
+ * in the table with frequencies for each note).
+ */
+
+ITCM_TEXT void SequencerEngine::triggerSequence(){
+	last_triggered_step = active_step;
+
+	double current_freq = getFreqOfNote(sequence[active_step]);
+
+	if(slide[active_step]){
+		double previous_freq = getFreqOfNote(sequence[modulo((active_step - 1), STEPS)]);
+		setSlide(current_freq, previous_freq);
+	}
+	else
+		setPitch(current_freq);
+	synthVolEnv.Trigger();
+	synthPitchEnv.Trigger();
+
+	// Increase the step in sequence, and set the next current note
+	active_step = (active_step + 1) % STEPS;
+	current_note = activated_notes[active_step];
+}
+
+/**
+ * @brief
+ * Called on each tick. Plays the active step if it is activated,
+ * otherwise just moves on to the next step.
+ */
+
+ITCM_TEXT void SequencerEngine::advanceSequence(){
+	if(current_note)
+		triggerSequence();
+	else {
+		active_step = (active_step + 1) % STEPS;
+		current_note = activated_notes[active_step];
+	}
+}
+
+/**
+ * @brief
+ * Normally the audio block is rendered first and a note triggered on
+ * this tick is heard from the next block. With low_latency_transport the
+ * tick is handled first, and on start the tick is reset and the current
+ * step is played right away instead of waiting for the next tick.
+ */
+
+ITCM_TEXT bool SequencerEngine::processBlock(float* out, size_t size){
+	bool triggered = false;
+	if(active) {
+		bool was_note = current_note;
+		if(low_latency_transport) {
+			bool step = tick.Process();
+			if(transport_started){
+				tick.Reset();
+				step = true;
+			}
+			if(step){
+				advanceSequence();
+				triggered = was_note;
+			}
+			prepareAudioBlock(size, out);
+		}
+		else {
+			prepareAudioBlock(size, out);
+			if(tick.Process()){
+				advanceSequence();
+				triggered = was_note;
+			}
+		}
+		transport_started = false;
+	}
+	else
+		for(size_t i = 0; i < size; i += 2) {
+			out[i] = out[i] * 0.9; // Audio ramp-down
+			out[i + 1] = out[i] * 0.9;
+		}
+	return triggered;
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include "daisysp.h"
+#include <cstddef>
+#include <cstdint>
+
+/*
+	SequencerEngine holds everything that makes the sound: the synth voice,
+	the tick and the sequence itself. It does not know about any hardware,
+	the firmware (303Sequencer.cpp) reads the buttons and pots and calls the
+	setters, and the batch renderer (render/) runs one engine per job on
+	the host. No globals, so several engines can run side by side.
+	All state is kept in fixed size members (no heap), so it stays in the
+	same memory as the engine itself, DTCM on the Daisy.
+
+	- STEPS: Number of steps in the sequence
+	- BLOCK_SIZE: Number of samples (per channel) in each call to
+	processBlock. The tick is only processed once per block, so the tempo
+	depends on this, always render with the same block size as the firmware.
+	- FILTER_MOVEMENT: How much the filter will move with each note.
+	Thought this will correspond to amount in frequency, but not sure
+	- MAX_SCALE_NOTES: Notes in the chromatic scale, C to C one octave up.
+
+	- sequence/scale: Notes are stored as indices into the chromatic scale
+	(0 = C, 12 = C one octave up), see noteName(). scale_size of the
+	entries in scale are used.
+	- slide/activated_notes: Slide and on/off for each step.
+
+	- active_step: The current active step, is incremented for each played
+	note
+	- mode_int: An integer corresponding to the current mode, i.e:
+	Ionian, Dorian, Phrygian, Lydian, Mixolydian, Aeolian or Locrian.
+	0 is chromatic.
+	- mode: This string specifies the steps for the scale going from the
+	root note upwards. It starts from the major scale (Ionian), which for
+	C is  "C", "D", "E", "F", "G", "A", "B".
+	This string will be left shifted to the left to change the mode.
+	- active: True/False if the sequencer is active or not.
+	- current_note: Will change based on array "activated_notes" and determine
+	if the current step should be played or not. Only updated each tick.
+	- low_latency_transport: If true the tick is re-phased on start and the
+	sequencer is run before the audio block, so the first step is heard in
+	the same block as the start.
+	- transport_started: Set when the sequencer is started, cleared when the
+	first block after the start has been played.
+
+	- ITCM_TEXT: Places a function in the .itcm_text section, which is
+	copied from flash to ITCM (zero wait state) before the static
+	constructors run.
+	Used for everything that runs inside the AudioCallback.
+	See 303Sequencer_itcm.ld. Does nothing when built for the host.
+*/
+
+#ifdef STM32H750xx
+#define ITCM_TEXT __attribute__((section(".itcm_text")))
+#else
+#define ITCM_TEXT
+#endif
+
+class SequencerEngine {
+public:
+	static int const STEPS = 16;
+	static size_t const BLOCK_SIZE = 4;
+	static int const FILTER_MOVEMENT = 11000;
+	static int const MAX_SCALE_NOTES = 13;
+
+	SequencerEngine();
+
+	void init(float samplerate);
+
+	/**
+	 * @brief
+	 * Fills an interleaved stereo buffer, size is the number of floats
+	 * (2 * BLOCK_SIZE). Returns true if a note was triggered in this block,
+	 * see lastTriggeredStep().
+	 */
+	bool processBlock(float* out, size_t size);
+
+	void start();
+	void stop();
+	bool isActive() const { return active; }
+	void setLowLatencyTransport(bool enabled) { low_latency_transport = enabled; }
+
+	void setTempo(float bpm);
+	float getTempo() const { return tempo_bpm; }
+	void setCutoff(float freq) { cutoff = freq; }
+	void setResonance(float resonance);
+	void setDecay(float decay);
+	void setEnvMod(float amount) { env_mod = amount; }
+	void setDrive(float drive);
+
+	void nextMode();
+	void setMode(int new_mode);
+	int getMode() const { return mode_int; }
+	size_t scaleSize() const { return scale_size; }
+
+	void randomizeSequence(unsigned seed);
+	void toggleSlide(int step);
+	void toggleStep(int step);
+	void setStepNote(int step, int scale_index);
+	void increasePitchForNote(int step);
+	int getStepNote(int step) const { return sequence[step]; }
+	static const char* noteName(int note);
+
+	int lastTriggeredStep() const { return last_triggered_step; }
+
+private:
+	void setPitch(double freq);
+	void setSlide(double note, double note_before);
+	void setChromaticScale();
+	void generateScale();
+	void prepareAudioBlock(size_t size, float* out);
+	void triggerSequence();
+	void advanceSequence();
+
+	daisysp::Oscillator osc;
+	daisysp::MoogLadder flt;
+	daisysp::Overdrive dist;
+	daisysp::AdEnv synthVolEnv, synthPitchEnv;
+	daisysp::Metro tick;
+
+	int active_step = 0;
+	int last_triggered_step = 0;
+	int mode_int = 0;
+
+	float env_mod = 0.8;
+	float cutoff = 13000.f;
+	float tempo_bpm = 120.f;
+
+	char mode[8] = "HWWHWWW"; // W = Whole step, H = Half step
+	bool active = false;
+	bool current_note = true;
+	bool low_latency_transport = false;
+	bool transport_started = false;
+
+	uint8_t scale[MAX_SCALE_NOTES];
+	int scale_size = 0;
+	uint8_t sequence[STEPS];
+	bool slide[STEPS];
+	bool activated_notes[STEPS];
+};
@@ -0,0 +1,98 @@
+# Per-region memory report for the Daisy Seed (STM32H750).
+#
+# Takes the regions (name, origin, length) from the "Memory Configuration"
+# table of the linker map file, so they always match the linker script
+# that was used. Then reads the output of "objdump -h" on the final elf
+# and sums up every allocated section into the region its VMA lands in. Sections that are
+# loaded from somewhere else (.data, .itcm_text, ...) are also counted
+# against the region of their LMA, since they take up space in both.
+#
+# Prints used size, region size and headroom for each region and exits
+# with an error if any region is used above "budget" percent (default 100).
+#
+# Usage: arm-none-eabi-objdump -h build/303Sequencer.elf |
+#        awk -v map=build/303Sequencer.map -v budget=90 -f memory_report.awk
+
+function hex(s,    i, c, v) {
+	v = 0
+	s = tolower(s)
+	sub(/^0x/, "", s)
+	for (i = 1; i <= length(s); i++) {
+		c = index("0123456789abcdef", substr(s, i, 1))
+		v = v * 16 + c - 1
+	}
+	return v
+}
+
+function add_region(name, origin, size) {
+	region_count++
+	region_name[region_count] = name
+	region_origin[region_count] = origin
+	region_length[region_count] = size
+	region_used[region_count] = 0
+}
+
+function region_of(addr,    r) {
+	for (r = 1; r <= region_count; r++)
+		if (addr >= region_origin[r] && addr < region_origin[r] + region_length[r])
+			return r
+	return 0
+}
+
+BEGIN {
+	if (budget == "")
+		budget = 100
+
+	# "FLASH            0x08000000         0x00020000         xr"
+	while ((getline line < map) > 0) {
+		if (line ~ /^Memory Configuration/)
+			in_config = 1
+		else if (line ~ /^Linker script and memory map/)
+			break
+		else if (in_config && split(line, field) >= 3 && field[2] ~ /^0x/ && field[1] != "*default*")
+			add_region(field[1], hex(field[2]), hex(field[3]))
+	}
+	close(map)
+
+	if (region_count == 0) {
+		print "error: no memory regions found in map file \"" map "\"" > "/dev/stderr"
+		failed = 1
+		exit 1
+	}
+}
+
+# "  3 .data  00000123  24000000  08012345  00020000  2**2"
+$1 ~ /^[0-9]+$/ && NF >= 6 {
+	size = hex($3)
+	vma_region = region_of(hex($4))
+	lma_region = region_of(hex($5))
+	getline flags
+
+	if (flags !~ /ALLOC/)
+		next
+	if (vma_region)
+		region_used[vma_region] += size
+	if (flags ~ /LOAD/ && lma_region && lma_region != vma_region)
+		region_used[lma_region] += size
+}
+
+END {
+	if (failed)
+		exit 1
+	printf("%-10s %10s %10s %10s %7s\n", "Region", "Used", "Size", "Free", "Used%")
+	for (r = 1; r <= region_count; r++) {
+		used = region_used[r]
+		percent = 100.0 * used / region_length[r]
+		printf("%-10s %10d %10d %10d %6.2f%%", region_name[r], used,
+			region_length[r], region_length[r] - used, percent)
+		if (percent > budget) {
+			printf("  <-- over budget (%d%%)", budget)
+			failed = 1
+		}
+		printf("\n")
+	}
+	if (failed) {
+		print "error: memory budget exceeded" > "/dev/stderr"
+		exit 1
+	}
+}
@@ -0,0 +1,201 @@
+#include "AudioFeatures.h"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+using namespace std;
+
+static float const SILENCE_DB = -120.f;
+static size_t const FFT_SIZE = 2048;
+static float const ROLLOFF = 0.85f;
+
+static float toDb(double power_ratio){
+	if(power_ratio <= 0)
+		return SILENCE_DB;
+	return max(SILENCE_DB, static_cast<float>(10 * log10(power_ratio)));
+}
+
+/**
+ * @brief
+ * Direct form I biquad, a0 normalized to 1.
+ */
+
+struct Biquad {
+	double b0, b1, b2, a1, a2;
+	double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+
+	double process(double x){
+		double y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+		x2 = x1; x1 = x;
+		y2 = y1; y1 = y;
+		return y;
+	}
+};
+
+/**
+ * @brief
+ * K-weighting filter from BS.1770 (high shelf followed by a high pass),
+ * with the coefficients worked out for any samplerate.
+ */
+
+static vector<double> kWeight(const vector<float>& samples, float samplerate){
+	double K = tan(M_PI * 1681.974450955533 / samplerate);
+	double Q = 0.7071752369554196;
+	double Vh = pow(10.0, 3.999843853973347 / 20.0);
+	double Vb = pow(Vh, 0.4996667741545416);
+	double a0 = 1 + K / Q + K * K;
+	Biquad shelf = {(Vh + Vb * K / Q + K * K) / a0, 2 * (K * K - Vh) / a0,
+		(Vh - Vb * K / Q + K * K) / a0, 2 * (K * K - 1) / a0, (1 - K / Q + K * K) / a0};
+
+	K = tan(M_PI * 38.13547087602444 / samplerate);
+	Q = 0.5003270373238773;
+	a0 = 1 + K / Q + K * K;
+	Biquad high_pass = {1, -2, 1, 2 * (K * K - 1) / a0, (1 - K / Q + K * K) / a0};
+
+	vector<double> weighted(samples.size());
+	for(size_t i = 0; i < samples.size(); i++)
+		weighted[i] = high_pass.process(shelf.process(samples[i]));
+	return weighted;
+}
+
+/**
+ * @brief
+ * Gated loudness: mean square over 400 ms blocks with 75% overlap,
+ * blocks below -70 LUFS are dropped, then blocks more than 10 LU below
+ * the mean of the rest.
+ */
+
+static float integratedLoudness(const vector<float>& samples, float samplerate){
+	vector<double> weighted = kWeight(samples, samplerate);
+	size_t block = static_cast<size_t>(0.4f * samplerate);
+	size_t hop = block / 4;
+	if(block == 0 || weighted.size() < block)
+		return SILENCE_DB;
+
+	vector<double> powers;
+	for(size_t start = 0; start + block <= weighted.size(); start += hop){
+		double sum = 0;
+		for(size_t i = start; i < start + block; i++)
+			sum += weighted[i] * weighted[i];
+		powers.push_back(sum / block);
+	}
+
+	auto gatedMean = [&](double threshold_lufs){
+		double sum = 0;
+		size_t count = 0;
+		for(double power : powers)
+			if(power > 0 && -0.691 + 10 * log10(power) > threshold_lufs){
+				sum += power;
+				count++;
+			}
+		return count ? sum / count : 0.0;
+	};
+
+	double absolute = gatedMean(-70.0);
+	if(absolute <= 0)
+		return SILENCE_DB;
+	double relative = gatedMean(-0.691 + 10 * log10(absolute) - 10.0);
+	if(relative <= 0)
+		return SILENCE_DB;
+	return static_cast<float>(-0.691 + 10 * log10(relative));
+}
+
+/**
+ * @brief
+ * In-place iterative radix-2 FFT, size must be a power of two.
+ */
+
+static void fft(vector<complex<double>>& data){
+	size_t n = data.size();
+	for(size_t i = 1, j = 0; i < n; i++){
+		size_t bit = n >> 1;
+		for(; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if(i < j)
+			swap(data[i], data[j]);
+	}
+
+	for(size_t length = 2; length <= n; length <<= 1){
+		complex<double> step = polar(1.0, -2 * M_PI / length);
+		for(size_t i = 0; i < n; i += length){
+			complex<double> w = 1;
+			for(size_t k = 0; k < length / 2; k++){
+				complex<double> even = data[i + k];
+				complex<double> odd = data[i + k + length / 2] * w;
+				data[i + k] = even + odd;
+				data[i + k + length / 2] = even - odd;
+				w *= step;
+			}
+		}
+	}
+}
+
+static vector<double> averagePowerSpectrum(const vector<float>& samples){
+	vector<double> power(FFT_SIZE / 2 + 1, 0.0);
+	vector<double> window(FFT_SIZE);
+	for(size_t i = 0; i < FFT_SIZE; i++)
+		window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / FFT_SIZE);
+
+	vector<complex<double>> frame(FFT_SIZE);
+	size_t frames = 0;
+	for(size_t start = 0; start + FFT_SIZE <= samples.size(); start += FFT_SIZE / 2){
+		for(size_t i = 0; i < FFT_SIZE; i++)
+			frame[i] = samples[start + i] * window[i];
+		fft(frame);
+		for(size_t k = 0; k < power.size(); k++)
+			power[k] += norm(frame[k]);
+		frames++;
+	}
+
+	if(frames)
+		for(double& bin : power)
+			bin /= frames;
+	return power;
+}
+
+AudioFeatures analyzeAudio(const vector<float>& samples, float samplerate){
+	AudioFeatures features = {};
+
+	double peak = 0, sum_squares = 0;
+	size_t crossings = 0;
+	for(size_t i = 0; i < samples.size(); i++){
+		peak = max(peak, static_cast<double>(fabs(samples[i])));
+		sum_squares += samples[i] * samples[i];
+		if(i > 0 && (samples[i] >= 0) != (samples[i - 1] >= 0))
+			crossings++;
+	}
+	double mean_square = samples.empty() ? 0 : sum_squares / samples.size();
+
+	features.peak_dbfs = toDb(peak * peak);
+	features.rms_dbfs = toDb(mean_square);
+	features.crest_db = features.peak_dbfs - features.rms_dbfs;
+	features.loudness_lufs = integratedLoudness(samples, samplerate);
+	features.zero_crossing_rate = samples.size() > 1
+		? static_cast<float>(crossings) / (samples.size() - 1) : 0;
+
+	vector<double> power = averagePowerSpectrum(samples);
+	double bin_hz = samplerate / FFT_SIZE;
+	double total = 0, weighted = 0, log_sum = 0;
+	for(size_t k = 0; k < power.size(); k++){
+		total += power[k];
+		weighted += k * bin_hz * power[k];
+		log_sum += log(power[k] + 1e-20);
+	}
+	if(total <= 0)
+		return features;
+
+	features.spectral_centroid_hz = static_cast<float>(weighted / total);
+	features.spectral_flatness = static_cast<float>(
+		exp(log_sum / power.size()) / (total / power.size()));
+
+	double below = 0;
+	for(size_t k = 0; k < power.size(); k++){
+		below += power[k];
+		if(below >= ROLLOFF * total){
+			features.spectral_rolloff_hz = static_cast<float>(k * bin_hz);
+			break;
+		}
+	}
+	return features;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <vector>
+
+/*
+	Summary features of a mono render, written to the CSV by batch_render.
+
+	- peak_dbfs/rms_dbfs: Sample peak and RMS level, 0 dB is full scale.
+	- crest_db: Peak to RMS ratio.
+	- loudness_lufs: Gated integrated loudness (ITU-R BS.1770), the mono
+	signal counted as a single channel.
+	- spectral_centroid_hz/spectral_rolloff_hz/spectral_flatness: From the
+	power spectrum averaged over 2048 sample Hann windowed frames. Rolloff
+	is where 85% of the energy is below.
+	- zero_crossing_rate: Sign changes per sample.
+
+	Silence gives -120 dB/LUFS instead of -inf.
+*/
+
+struct AudioFeatures {
+	float peak_dbfs;
+	float rms_dbfs;
+	float crest_db;
+	float loudness_lufs;
+	float spectral_centroid_hz;
+	float spectral_rolloff_hz;
+	float spectral_flatness;
+	float zero_crossing_rate;
+};
+
+AudioFeatures analyzeAudio(const std::vector<float>& samples, float samplerate);
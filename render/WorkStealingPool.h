@@ -0,0 +1,94 @@
+#pragma once
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+	Runs a fixed number of jobs over a set of worker threads.
+
+	Every worker has its own queue of job indices, filled round-robin
+	before the workers start. A worker takes jobs from the back of its own
+	queue and, when that is empty, steals from the front of the others.
+	Renders of different length (tempo, seconds) then still keep all cores
+	busy until the very end. No jobs are added while running, so a worker
+	that finds every queue empty is done.
+
+	The first exception thrown by a job is rethrown from run() once all
+	workers have stopped.
+*/
+
+class WorkStealingPool {
+public:
+	explicit WorkStealingPool(size_t worker_count)
+		: queues(worker_count > 0 ? worker_count : 1)
+	{
+	}
+
+	size_t workerCount() const { return queues.size(); }
+
+	void run(size_t job_count, const std::function<void(size_t)>& job){
+		for(size_t i = 0; i < job_count; i++)
+			queues[i % queues.size()].jobs.push_back(i);
+
+		error = nullptr;
+		std::vector<std::thread> workers;
+		for(size_t w = 0; w < queues.size(); w++)
+			workers.emplace_back([this, w, &job]{ work(w, job); });
+		for(std::thread& worker : workers)
+			worker.join();
+
+		if(error)
+			std::rethrow_exception(error);
+	}
+
+private:
+	struct Queue {
+		std::mutex lock;
+		std::deque<size_t> jobs;
+	};
+
+	bool popOwn(size_t worker, size_t& job){
+		Queue& queue = queues[worker];
+		std::lock_guard<std::mutex> guard(queue.lock);
+		if(queue.jobs.empty())
+			return false;
+		job = queue.jobs.back();
+		queue.jobs.pop_back();
+		return true;
+	}
+
+	bool steal(size_t worker, size_t& job){
+		for(size_t i = 1; i < queues.size(); i++){
+			Queue& victim = queues[(worker + i) % queues.size()];
+			std::lock_guard<std::mutex> guard(victim.lock);
+			if(victim.jobs.empty())
+				continue;
+			job = victim.jobs.front();
+			victim.jobs.pop_front();
+			return true;
+		}
+		return false;
+	}
+
+	void work(size_t worker, const std::function<void(size_t)>& job){
+		size_t index;
+		while(popOwn(worker, index) || steal(worker, index)){
+			try {
+				job(index);
+			}
+			catch(...) {
+				std::lock_guard<std::mutex> guard(error_lock);
+				if(!error)
+					error = std::current_exception();
+			}
+		}
+	}
+
+	std::vector<Queue> queues;
+	std::mutex error_lock;
+	std::exception_ptr error;
+};
@@ -0,0 +1,349 @@
+#include "SequencerEngine.h"
+#include "AudioFeatures.h"
+#include "WorkStealingPool.h"
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/*
+	Host batch renderer for auditioning patterns.
+
+	Renders SequencerEngine offline for every combination of seed, mode,
+	tempo and sound parameters, spread over all cores. Each job gets its
+	own engine, nothing is shared between jobs except the read only
+	settings. Writes one mono 16-bit WAV per job and a features.csv with
+	the settings, the generated sequence and the AudioFeatures of each
+	render, in job order.
+
+	A job is the same as switching the mode button "mode" times from boot,
+	pressing random with the seed, setting the pots and pressing start.
+*/
+
+struct Settings {
+	unsigned first_seed = 1;
+	unsigned seeds = 16;
+	vector<double> modes = {0};
+	vector<double> tempos = {120};
+	vector<double> cutoffs = {13000};
+	vector<double> resonances = {0.7};
+	vector<double> decays = {1};
+	vector<double> env_mods = {0.8};
+	vector<double> drives = {0.5};
+	float seconds = 8;
+	float samplerate = 48000;
+	size_t jobs = 0; // 0 = one per core
+	string out_dir = "renders";
+};
+
+static unsigned const MAX_JOBS = 1024;
+
+struct RenderJob {
+	unsigned seed;
+	int mode;
+	float tempo, cutoff, resonance, decay, env_mod, drive;
+};
+
+struct RenderResult {
+	string file;
+	string sequence;
+	AudioFeatures features;
+};
+
+static void printUsage(){
+	cerr <<
+		"Usage: batch_render [options]\n"
+		"  Lists are comma separated, every combination is rendered.\n"
+		"  --seeds N          number of random patterns per combination (16)\n"
+		"  --first-seed N     first seed (1)\n"
+		"  --modes LIST       modes 0-7, 0 is chromatic (0)\n"
+		"  --tempos LIST      bpm (120)\n"
+		"  --cutoffs LIST     filter cutoff in Hz (13000)\n"
+		"  --resonances LIST  0 - 0.89 (0.7)\n"
+		"  --decays LIST      volume decay in seconds (1)\n"
+		"  --env-mods LIST    0 - 1 (0.8)\n"
+		"  --drives LIST      0 - 0.7 (0.5)\n"
+		"  --seconds S        length of each render (8)\n"
+		"  --samplerate SR    (48000)\n"
+		"  --jobs N           worker threads, 0 = one per core, max 1024 (0)\n"
+		"  --out DIR          output directory (renders)\n";
+}
+
+static vector<double> parseList(const string& text){
+	vector<double> values;
+	stringstream stream(text);
+	string item;
+	while(getline(stream, item, ',')){
+		char* end;
+		double value = strtod(item.c_str(), &end);
+		if(item.empty() || *end != '\0')
+			throw invalid_argument("not a number: " + item);
+		values.push_back(value);
+	}
+	if(values.empty())
+		throw invalid_argument("empty list");
+	return values;
+}
+
+static double parseNumber(const string& text){
+	vector<double> values = parseList(text);
+	if(values.size() != 1)
+		throw invalid_argument("expected a single number: " + text);
+	return values[0];
+}
+
+/**
+ * @brief
+ * Parses a whole number from min to max.
+ */
+
+static double parseCount(const string& option, const string& text, double min, double max){
+	double value = parseNumber(text);
+	if(value < min || value > max || value != floor(value))
+		throw invalid_argument(option + " must be a whole number in the range "
+			+ to_string(static_cast<uint64_t>(min)) + "-" + to_string(static_cast<uint64_t>(max)));
+	return value;
+}
+
+static Settings parseArguments(int argc, char** argv){
+	Settings settings;
+	for(int i = 1; i < argc; i++){
+		string option = argv[i];
+		if(option == "--help" || option == "-h"){
+			printUsage();
+			exit(0);
+		}
+		if(i + 1 >= argc)
+			throw invalid_argument("missing value for " + option);
+		string value = argv[++i];
+
+		if(option == "--seeds") settings.seeds = static_cast<unsigned>(parseCount(option, value, 1, UINT32_MAX));
+		else if(option == "--first-seed") settings.first_seed = static_cast<unsigned>(parseCount(option, value, 0, UINT32_MAX));
+		else if(option == "--modes") settings.modes = parseList(value);
+		else if(option == "--tempos") settings.tempos = parseList(value);
+		else if(option == "--cutoffs") settings.cutoffs = parseList(value);
+		else if(option == "--resonances") settings.resonances = parseList(value);
+		else if(option == "--decays") settings.decays = parseList(value);
+		else if(option == "--env-mods") settings.env_mods = parseList(value);
+		else if(option == "--drives") settings.drives = parseList(value);
+		else if(option == "--seconds") settings.seconds = static_cast<float>(parseNumber(value));
+		else if(option == "--samplerate") settings.samplerate = static_cast<float>(parseNumber(value));
+		else if(option == "--jobs") settings.jobs = static_cast<size_t>(parseCount(option, value, 0, MAX_JOBS));
+		else if(option == "--out") settings.out_dir = value;
+		else throw invalid_argument("unknown option " + option);
+	}
+
+	if(static_cast<uint64_t>(settings.first_seed) + settings.seeds - 1 > UINT32_MAX)
+		throw invalid_argument("the last seed (--first-seed + --seeds - 1) must be at most 4294967295");
+	if(settings.seconds <= 0 || settings.samplerate <= 0)
+		throw invalid_argument("--seconds and --samplerate must be positive");
+	for(double mode : settings.modes)
+		if(mode < 0 || mode > 7 || mode != floor(mode))
+			throw invalid_argument("modes must be whole numbers in the range 0-7");
+	for(double tempo : settings.tempos)
+		if(tempo <= 0)
+			throw invalid_argument("tempos must be positive");
+	return settings;
+}
+
+/**
+ * @brief
+ * Creates the output directory, an existing one is fine. Parent
+ * directories are not created.
+ */
+
+static void makeOutputDir(const string& path){
+	if(mkdir(path.c_str(), 0755) == 0)
+		return;
+	if(errno != EEXIST)
+		throw runtime_error("could not create " + path + ": " + strerror(errno));
+
+	struct stat info;
+	if(stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+		throw runtime_error("could not create " + path + ": not a directory");
+}
+
+static vector<RenderJob> makeJobs(const Settings& s){
+	vector<RenderJob> jobs;
+	for(double mode : s.modes)
+	for(double tempo : s.tempos)
+	for(double cutoff : s.cutoffs)
+	for(double resonance : s.resonances)
+	for(double decay : s.decays)
+	for(double env_mod : s.env_mods)
+	for(double drive : s.drives)
+	for(unsigned i = 0; i < s.seeds; i++)
+		jobs.push_back({s.first_seed + i, static_cast<int>(mode), static_cast<float>(tempo),
+			static_cast<float>(cutoff), static_cast<float>(resonance),
+			static_cast<float>(decay), static_cast<float>(env_mod), static_cast<float>(drive)});
+	return jobs;
+}
+
+/**
+ * @brief
+ * Runs a fresh engine for the job and returns the left channel.
+ * The engine is run in blocks of SequencerEngine::BLOCK_SIZE, like on
+ * the Daisy, so the tempo comes out the same.
+ */
+
+static vector<float> renderJob(const RenderJob& job, const Settings& settings, string& sequence){
+	SequencerEngine engine;
+	engine.init(settings.samplerate);
+	engine.setMode(job.mode);
+	engine.randomizeSequence(job.seed);
+	engine.setTempo(job.tempo);
+	engine.setCutoff(job.cutoff);
+	engine.setResonance(job.resonance);
+	engine.setDecay(job.decay);
+	engine.setEnvMod(job.env_mod);
+	engine.setDrive(job.drive);
+	engine.start();
+
+	for(int step = 0; step < SequencerEngine::STEPS; step++)
+		sequence += string(step ? " " : "") + SequencerEngine::noteName(engine.getStepNote(step));
+
+	size_t const block_size = SequencerEngine::BLOCK_SIZE;
+	size_t blocks = static_cast<size_t>(settings.seconds * settings.samplerate) / block_size;
+	vector<float> samples(blocks * block_size);
+	float block[2 * block_size] = {};
+
+	for(size_t b = 0; b < blocks; b++){
+		engine.processBlock(block, 2 * block_size);
+		for(size_t i = 0; i < block_size; i++)
+			samples[b * block_size + i] = block[2 * i];
+	}
+	return samples;
+}
+
+static void writeLittleEndian(ofstream& file, uint32_t value, int bytes){
+	for(int i = 0; i < bytes; i++)
+		file.put(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+/**
+ * @brief
+ * Writes a mono 16-bit PCM WAV, samples are clipped to -1 - 1.
+ */
+
+static void writeWav(const string& path, const vector<float>& samples, float samplerate){
+	ofstream file(path, ios::binary);
+	if(!file)
+		throw runtime_error("could not open " + path);
+
+	uint32_t rate = static_cast<uint32_t>(samplerate);
+	uint32_t data_size = static_cast<uint32_t>(samples.size() * 2);
+	file.write("RIFF", 4);
+	writeLittleEndian(file, 36 + data_size, 4);
+	file.write("WAVEfmt ", 8);
+	writeLittleEndian(file, 16, 4);       // fmt chunk size
+	writeLittleEndian(file, 1, 2);        // PCM
+	writeLittleEndian(file, 1, 2);        // mono
+	writeLittleEndian(file, rate, 4);
+	writeLittleEndian(file, rate * 2, 4); // bytes per second
+	writeLittleEndian(file, 2, 2);        // bytes per frame
+	writeLittleEndian(file, 16, 2);       // bits per sample
+	file.write("data", 4);
+	writeLittleEndian(file, data_size, 4);
+
+	for(float sample : samples){
+		float clipped = sample > 1.f ? 1.f : (sample < -1.f ? -1.f : sample);
+		int16_t value = static_cast<int16_t>(clipped * 32767.f);
+		writeLittleEndian(file, static_cast<uint16_t>(value), 2);
+	}
+
+	if(!file)
+		throw runtime_error("could not write " + path);
+}
+
+static string fileName(const RenderJob& job, size_t index){
+	char name[96];
+	snprintf(name, sizeof(name), "%06zu_s%u_m%d_t%g.wav", index, job.seed, job.mode, job.tempo);
+	return name;
+}
+
+static void writeCsv(const string& path, const vector<RenderJob>& jobs, const vector<RenderResult>& results){
+	ofstream csv(path);
+	if(!csv)
+		throw runtime_error("could not open " + path);
+
+	csv << "file,seed,mode,tempo,cutoff,resonance,decay,env_mod,drive,sequence,"
+		"peak_dbfs,rms_dbfs,crest_db,loudness_lufs,"
+		"spectral_centroid_hz,spectral_rolloff_hz,spectral_flatness,zero_crossing_rate\n";
+	for(size_t i = 0; i < jobs.size(); i++){
+		const RenderJob& job = jobs[i];
+		const AudioFeatures& f = results[i].features;
+		csv << results[i].file << ',' << job.seed << ',' << job.mode << ','
+			<< job.tempo << ',' << job.cutoff << ',' << job.resonance << ','
+			<< job.decay << ',' << job.env_mod << ',' << job.drive << ','
+			<< results[i].sequence << ','
+			<< f.peak_dbfs << ',' << f.rms_dbfs << ',' << f.crest_db << ','
+			<< f.loudness_lufs << ',' << f.spectral_centroid_hz << ','
+			<< f.spectral_rolloff_hz << ',' << f.spectral_flatness << ','
+			<< f.zero_crossing_rate << '\n';
+	}
+
+	if(!csv)
+		throw runtime_error("could not write " + path);
+}
+
+int main(int argc, char** argv){
+	Settings settings;
+	try {
+		settings = parseArguments(argc, argv);
+	}
+	catch(const exception& e) {
+		cerr << "batch_render: " << e.what() << "\n\n";
+		printUsage();
+		return 1;
+	}
+
+	try {
+		makeOutputDir(settings.out_dir);
+	}
+	catch(const exception& e) {
+		cerr << "batch_render: " << e.what() << "\n";
+		return 1;
+	}
+
+	vector<RenderJob> jobs = makeJobs(settings);
+	vector<RenderResult> results(jobs.size());
+	size_t workers = settings.jobs ? settings.jobs : thread::hardware_concurrency();
+
+	atomic<size_t> done(0);
+	try {
+		WorkStealingPool pool(workers);
+		cerr << "Rendering " << jobs.size() << " patterns on " << pool.workerCount() << " threads\n";
+
+		pool.run(jobs.size(), [&](size_t index){
+			RenderResult& result = results[index];
+			vector<float> samples = renderJob(jobs[index], settings, result.sequence);
+			result.file = fileName(jobs[index], index);
+			writeWav(settings.out_dir + "/" + result.file, samples, settings.samplerate);
+			result.features = analyzeAudio(samples, settings.samplerate);
+
+			size_t finished = ++done;
+			if(finished % 100 == 0 || finished == jobs.size())
+				cerr << finished << "/" << jobs.size() << "\n";
+		});
+		writeCsv(settings.out_dir + "/features.csv", jobs, results);
+	}
+	catch(const exception& e) {
+		cerr << "batch_render: " << e.what() << "\n";
+		return 1;
+	}
+
+	return 0;
+}